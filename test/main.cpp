@@ -3,6 +3,13 @@
 
 #include <lazycsv.hpp>
 
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
 template<class T>
 void
 check_rows(
@@ -23,6 +30,28 @@ check_rows(
     REQUIRE_EQ(row_index, expected_rows.size());
 }
 
+// A header and rows, two in three of which have a quoted cell with a newline,
+// a delimiter and an escaped quote in it and end with CRLF
+std::string
+quoted_rows_csv(int rows)
+{
+    std::string csv = "id,text\n";
+    for(int i = 0; i < rows; i++)
+        csv += std::to_string(i) + (i % 3 ? ",\"a\nb,\"\"\"\r\n" : ",c\n");
+    return csv;
+}
+
+// The raw text of the rows the parser goes through
+template<class T>
+std::vector<std::string>
+raw_rows(T&& parser)
+{
+    std::vector<std::string> rows;
+    for(const auto row : parser)
+        rows.emplace_back(row.raw());
+    return rows;
+}
+
 TEST_CASE("mmap_source zero_length")
 {
     lazycsv::mmap_source source{ "inputs/zero_length.csv" };
@@ -46,6 +75,27 @@ TEST_CASE("mmap_source basic.csv")
 #endif
 }
 
+TEST_CASE("mmap_source options don't change the data")
+{
+    lazycsv::mmap_source plain{ "inputs/basic.csv" };
+
+    lazycsv::mmap_options options;
+    options.populate   = true;
+    options.sequential = true;
+    options.will_need  = true;
+    options.fadvise    = true;
+    options.huge_pages = true;
+    lazycsv::mmap_source source{ "inputs/basic.csv", options };
+
+    REQUIRE(source.options().populate);
+    REQUIRE_EQ(
+        std::string_view{ source.data(), source.size() },
+        std::string_view{ plain.data(), plain.size() });
+
+    lazycsv::parser<lazycsv::mmap_source> parser{ "inputs/basic.csv", options };
+    REQUIRE_EQ(parser.header().raw(), "A0,B0,C0,D0");
+}
+
 TEST_CASE("parse basic.csv with mmap_source and use cells function")
 {
     lazycsv::parser parser{ "inputs/basic.csv" };
@@ -233,3 +283,1069 @@ TEST_CASE("quoted cells and \\r\\n as newline")
     auto [b3]  = row_3->cells(1);
     REQUIRE_EQ("\"B3\"", b3.unescaped());
 }
+
+TEST_CASE("long cells spanning multiple blocks")
+{
+    const std::string a(70, 'a');
+    const std::string b(130, 'b');
+    // quoted delimiters on both sides of the 64 bytes block boundaries
+    const std::string quoted = '"' + std::string(60, 'q') + ",,\"\"" +
+                               std::string(70, 'q') + ",\"";
+    const std::string wide = std::string(200, ',');
+
+    lazycsv::parser<std::string, lazycsv::has_header<false>> parser{
+        a + ',' + b + '\n' + quoted + ',' + a + "\n" + b + wide + "\n"
+    };
+
+    std::vector<std::string> wide_cells(201);
+    wide_cells.front() = b;
+    check_rows(
+        parser,
+        { { a, b },
+          { std::string(60, 'q') + ",,\"\"" + std::string(70, 'q') + ",", a },
+          wide_cells });
+}
+
+TEST_CASE("newlines in quoted cells")
+{
+    const std::string long_cell = std::string(100, 'x') + "\n\n" +
+                                  std::string(100, 'y') + "\r\n";
+
+    lazycsv::parser<std::string, lazycsv::has_header<false>> parser{
+        "A0,\"B\n0\",C0\n\"A1\r\n\",B1,\"\"\"C\n1\"\nA2,\"" + long_cell +
+        "\",C2\r\n"
+    };
+    check_rows(
+        parser,
+        { { "A0", "B\n0", "C0" },
+          { "A1\r\n", "B1", "\"\"C\n1" },
+          { "A2", long_cell, "C2" } });
+}
+
+TEST_CASE("quote left open in the last row")
+{
+    lazycsv::parser<std::string, lazycsv::has_header<false>> parser{
+        "A0,B0\nA1,\"B1\n,C1\n"
+    };
+    check_rows(parser, { { "A0", "B0" }, { "A1", "\"B1\n,C1" } });
+}
+
+TEST_CASE("quoted_newlines<false> splits rows on every newline")
+{
+    lazycsv::parser<
+        std::string,
+        lazycsv::has_header<false>,
+        lazycsv::delimiter<','>,
+        lazycsv::quote_char<'"'>,
+        lazycsv::trim_chars<' ', '\t'>,
+        lazycsv::quoted_newlines<false>>
+        parser{ "A0,\"B\n0\",C0\nA1,B1,C1\n" };
+    check_rows(
+        parser, { { "A0", "\"B" }, { "0\",C0" }, { "A1", "B1", "C1" } });
+}
+
+TEST_CASE("structural_index gives the same rows and cells")
+{
+    const std::string long_cell =
+        std::string(100, 'x') + "\n,\"\"" + std::string(100, 'y');
+    const std::string csv = "A0,\"B\n0\",C0\r\n\"A1,\"\"\",,\n\n" + long_cell +
+                            ",\"" + long_cell + "\"," + long_cell + "\nA3";
+
+    // rows longer than the 64 KiB blocks of the index, so some blocks have no
+    // row end, and cells of quoted newlines
+    std::string long_rows = csv + "\n";
+    for(int i = 0; i < 40; i++)
+        long_rows += std::string(i * 3000, 'x') + ",\"" +
+                     std::string(i * 500, '\n') + "\"\n";
+
+    const auto check_same_rows = [](auto quoted_newlines,
+                                    const std::string& input) {
+        using quoted_newlines_t = decltype(quoted_newlines);
+        const lazycsv::parser<
+            std::string,
+            lazycsv::has_header<true>,
+            lazycsv::delimiter<','>,
+            lazycsv::quote_char<'"'>,
+            lazycsv::trim_chars<' ', '\t'>,
+            quoted_newlines_t>
+            scanning{ input };
+        const lazycsv::parser<
+            std::string,
+            lazycsv::has_header<true>,
+            lazycsv::delimiter<','>,
+            lazycsv::quote_char<'"'>,
+            lazycsv::trim_chars<' ', '\t'>,
+            quoted_newlines_t,
+            lazycsv::structural_index>
+            indexed{ input };
+
+        std::vector<std::vector<std::string>> expected_rows;
+        for(const auto row : scanning)
+        {
+            expected_rows.emplace_back();
+            for(const auto cell : row)
+                expected_rows.back().emplace_back(cell.trimmed());
+        }
+
+        REQUIRE_EQ(scanning.header().raw(), indexed.header().raw());
+        check_rows(indexed, expected_rows);
+        // a second pass reads the same index
+        check_rows(indexed, expected_rows);
+    };
+
+    for(const auto& input : { csv, long_rows })
+    {
+        check_same_rows(lazycsv::quoted_newlines<true>{}, input);
+        check_same_rows(lazycsv::quoted_newlines<false>{}, input);
+    }
+}
+
+TEST_CASE("row_index gives rows by their number")
+{
+    const std::string csv = "A,B\na0,\"b\n0\"\r\na1,b1\n\na3,b3\n";
+
+    const lazycsv::parser<
+        std::string,
+        lazycsv::has_header<true>,
+        lazycsv::delimiter<','>,
+        lazycsv::quote_char<'"'>,
+        lazycsv::trim_chars<' ', '\t'>,
+        lazycsv::quoted_newlines<true>,
+        lazycsv::row_index>
+        parser{ csv };
+
+    REQUIRE_EQ(parser.row_count(), 4);
+    REQUIRE_EQ(parser.row_at(0).raw(), "a0,\"b\n0\"");
+    REQUIRE_EQ(parser.row_at(1).raw(), "a1,b1");
+    REQUIRE_EQ(parser.row_at(2).raw(), "");
+    REQUIRE_EQ(parser.row_at(3).raw(), "a3,b3");
+    REQUIRE_THROWS_AS(parser.row_at(4), lazycsv::error);
+
+    auto [cell0, cell1] = parser.row_at(0).cells(0, 1);
+    REQUIRE_EQ(cell0.raw(), "a0");
+    REQUIRE_EQ(cell1.unescaped(), "b\n0");
+
+    check_rows(
+        parser,
+        { { "a0", "b\n0" }, { "a1", "b1" }, { "" }, { "a3", "b3" } });
+}
+
+TEST_CASE("row_index saved to a sidecar file")
+{
+    const std::string index_path = "inputs/basic.csv.index";
+    std::remove(index_path.c_str());
+
+    lazycsv::parser<
+        lazycsv::mmap_source,
+        lazycsv::has_header<true>,
+        lazycsv::delimiter<','>,
+        lazycsv::quote_char<'"'>,
+        lazycsv::trim_chars<' ', '\t'>,
+        lazycsv::quoted_newlines<true>,
+        lazycsv::row_index>
+        parser{ "inputs/basic.csv" };
+
+    // the first load builds the index and saves it
+    REQUIRE_FALSE(parser.load_index(index_path));
+    REQUIRE(parser.load_index(index_path));
+    REQUIRE_EQ(parser.row_count(), 3);
+    REQUIRE_EQ(parser.row_at(2).cells(3)[0].raw(), "D3");
+
+    // an index of another dialect is stale
+    lazycsv::parser<
+        lazycsv::mmap_source,
+        lazycsv::has_header<true>,
+        lazycsv::delimiter<','>,
+        lazycsv::quote_char<'\''>,
+        lazycsv::trim_chars<' ', '\t'>,
+        lazycsv::quoted_newlines<true>,
+        lazycsv::row_index>
+        other_dialect{ "inputs/basic.csv" };
+    REQUIRE_FALSE(other_dialect.load_index(index_path));
+    REQUIRE_EQ(other_dialect.row_at(0).cells(0)[0].raw(), "A1");
+
+    std::remove(index_path.c_str());
+}
+
+TEST_CASE("row_index gives random-access rows")
+{
+    const std::string csv = "key,value\n1,a\n3,\"b\nb\"\n5,c\n7,d\n";
+
+    const lazycsv::parser<
+        std::string,
+        lazycsv::has_header<true>,
+        lazycsv::delimiter<','>,
+        lazycsv::quote_char<'"'>,
+        lazycsv::trim_chars<' ', '\t'>,
+        lazycsv::quoted_newlines<true>,
+        lazycsv::row_index>
+        parser{ csv };
+
+    static_assert(std::is_same_v<
+                  std::iterator_traits<decltype(parser.begin())>::
+                      iterator_category,
+                  std::random_access_iterator_tag>);
+
+    REQUIRE_EQ(std::distance(parser.begin(), parser.end()), 4);
+    REQUIRE_EQ(parser.header().raw(), "key,value");
+    REQUIRE_EQ(parser.begin()[2].raw(), "5,c");
+    REQUIRE_EQ((parser.end() - 1)->raw(), "7,d");
+
+    const auto it = std::lower_bound(
+        parser.begin(), parser.end(), 4, [](auto row, int key) {
+            return std::stoi(std::string{ row.cells(0)[0].raw() }) < key;
+        });
+    REQUIRE_EQ(it - parser.begin(), 2);
+    REQUIRE_EQ(it->raw(), "5,c");
+
+    std::vector<std::string> reversed;
+    for(auto i = parser.end(); i != parser.begin();)
+        reversed.emplace_back((--i)->cells(1)[0].trimmed());
+    REQUIRE_EQ(reversed, std::vector<std::string>{ "d", "c", "b\nb", "a" });
+}
+
+TEST_CASE("checkpoint_index seeks to rows")
+{
+    std::string csv = "id,text\n";
+    for(int i = 0; i < 100; i++)
+        csv += std::to_string(i) + (i % 7 ? ",plain\n" : ",\"multi\nline\"\n");
+
+    lazycsv::parser<
+        std::string,
+        lazycsv::has_header<true>,
+        lazycsv::delimiter<','>,
+        lazycsv::quote_char<'"'>,
+        lazycsv::trim_chars<' ', '\t'>,
+        lazycsv::quoted_newlines<true>,
+        lazycsv::checkpoint_index>
+        parser{ csv };
+
+    const auto check_seek = [&]() {
+        REQUIRE_EQ(parser.row_count(), 100);
+        for(int i = 0; i < 100; i++)
+        {
+            auto it = parser.seek_row(i);
+            REQUIRE_EQ(it->cells(0)[0].raw(), std::to_string(i));
+            if(i < 99)
+                REQUIRE_EQ((++it)->cells(0)[0].raw(), std::to_string(i + 1));
+        }
+        REQUIRE(parser.seek_row(100) == parser.end());
+    };
+
+    check_seek();
+    parser.build_index(lazycsv::checkpoint_index{ 9 });
+    check_seek();
+    parser.build_index(lazycsv::checkpoint_index{ 1 });
+    check_seek();
+}
+
+TEST_CASE("refresh picks up appended rows")
+{
+    const auto check_refresh = [](auto index_policy) {
+        const std::string path = "inputs/appended.csv";
+        const auto write = [&](const char* data, std::ios::openmode mode) {
+            std::ofstream{ path, std::ios::binary | mode } << data;
+        };
+        const auto rows_from = [](auto it, auto end) {
+            std::vector<std::string> rows;
+            for(; it != end; ++it)
+                rows.emplace_back(it->raw());
+            return rows;
+        };
+        using strings = std::vector<std::string>;
+
+        write("h1,h2\na,1\nb,\"x", std::ios::trunc);
+        lazycsv::parser<
+            lazycsv::mmap_source,
+            lazycsv::has_header<true>,
+            lazycsv::delimiter<','>,
+            lazycsv::quote_char<'"'>,
+            lazycsv::trim_chars<' ', '\t'>,
+            lazycsv::quoted_newlines<true>,
+            decltype(index_policy)>
+            parser{ path };
+        // end() moves with the refresh, so it's taken after it
+        const auto refreshed = [&]() {
+            const auto it = parser.refresh();
+            return rows_from(it, parser.end());
+        };
+        REQUIRE_EQ(
+            rows_from(parser.begin(), parser.end()),
+            strings{ "a,1", "b,\"x" });
+
+        // the last row isn't complete, so it's returned again
+        REQUIRE_EQ(refreshed(), strings{ "b,\"x" });
+
+        write("\ny\",2\nc,3\n", std::ios::app);
+        REQUIRE_EQ(refreshed(), strings{ "b,\"x\ny\",2", "c,3" });
+
+        write("d,4", std::ios::app);
+        REQUIRE_EQ(refreshed(), strings{ "d,4" });
+        REQUIRE_EQ(
+            rows_from(parser.begin(), parser.end()),
+            strings{ "a,1", "b,\"x\ny\",2", "c,3", "d,4" });
+        REQUIRE_EQ(parser.begin()->cells(1)[0].unescaped(), "1");
+
+        write("h1,h2\nz,9\n", std::ios::trunc);
+        REQUIRE_EQ(refreshed(), strings{ "z,9" });
+
+        // the old mapping goes past the end of a file truncated by several
+        // pages, so the rows are looked for in the new one
+        std::string appended;
+        for(int i = 0; i < 5000; i++)
+            appended += "r," + std::to_string(i) + "\n";
+        write(appended.c_str(), std::ios::app);
+        REQUIRE_EQ(refreshed().size(), 5000);
+        write("h\nz,9\n", std::ios::trunc);
+        REQUIRE_EQ(refreshed(), strings{ "z,9" });
+
+        std::remove(path.c_str());
+    };
+
+    check_refresh(lazycsv::no_index{});
+    check_refresh(lazycsv::structural_index{});
+    check_refresh(lazycsv::row_index{});
+    check_refresh(lazycsv::checkpoint_index{});
+}
+
+TEST_CASE("indexed rows give cells by their index")
+{
+    std::string csv = "\"a,\"\"\",,c\r\n\n";
+    for(int i = 0; i < 300; i++)
+        csv += (i ? "," : "") + std::to_string(i);
+    csv += "\n";
+
+    const auto check_indexed_rows = [&](const auto& parser) {
+        lazycsv::cell_buffer buffer;
+        auto it = parser.begin();
+
+        auto row = (it++)->indexed(buffer);
+        REQUIRE_EQ(row.size(), 3);
+        REQUIRE_EQ(row[0].unescaped(), "a,\"");
+        REQUIRE_EQ(row[1].raw(), "");
+        REQUIRE_EQ(row[2].raw(), "c");
+        REQUIRE_THROWS_AS(row.at(3), lazycsv::error);
+
+        row = (it++)->indexed(buffer);
+        REQUIRE_EQ(row.size(), 1);
+        REQUIRE_EQ(row[0].raw(), "");
+
+        row = (it++)->indexed(buffer);
+        REQUIRE_EQ(row.size(), 300);
+        REQUIRE_EQ(row[0].raw(), "0");
+        REQUIRE_EQ(row[187].raw(), "187");
+        REQUIRE_EQ(row.at(299).raw(), "299");
+        REQUIRE(it == parser.end());
+    };
+
+    check_indexed_rows(
+        lazycsv::parser<std::string, lazycsv::has_header<false>>{ csv });
+    check_indexed_rows(
+        lazycsv::parser<
+            std::string,
+            lazycsv::has_header<false>,
+            lazycsv::delimiter<','>,
+            lazycsv::quote_char<'"'>,
+            lazycsv::trim_chars<' ', '\t'>,
+            lazycsv::quoted_newlines<true>,
+            lazycsv::structural_index>{ csv });
+}
+
+TEST_CASE("for_each_row_parallel gives every row once")
+{
+    const std::string csv = quoted_rows_csv(1000);
+
+    const auto check_parallel = [&](const auto& parser) {
+        std::vector<std::atomic<int>> seen(1000);
+        for(unsigned threads : { 1, 2, 3, 8, 64 })
+        {
+            parser.for_each_row_parallel(
+                [&](auto row) {
+                    seen.at(std::stoi(std::string{ row.cells(0)[0].raw() }))++;
+                },
+                threads);
+        }
+        for(const auto& count : seen)
+            REQUIRE_EQ(count, 5);
+    };
+
+    check_parallel(lazycsv::parser<std::string>{ csv });
+    check_parallel(
+        lazycsv::parser<
+            std::string,
+            lazycsv::has_header<true>,
+            lazycsv::delimiter<','>,
+            lazycsv::quote_char<'"'>,
+            lazycsv::trim_chars<' ', '\t'>,
+            lazycsv::quoted_newlines<true>,
+            lazycsv::row_index>{ csv });
+    REQUIRE_THROWS_AS(
+        lazycsv::parser<std::string>{ csv }.for_each_row_parallel(
+            [](auto row) { row.cells(2); }, 4),
+        lazycsv::error);
+}
+
+TEST_CASE("for_each_row_parallel with split points inside quotes")
+{
+    // rows of long quoted cells full of newlines, delimiters and escaped
+    // quotes, so most split points fall inside quotes
+    std::string csv;
+    for(int i = 0; i < 200; i++)
+    {
+        csv += std::to_string(i) + ",\"";
+        for(int j = 0; j < i % 17; j++)
+            csv += "\n\"\",\"\"\n,";
+        csv += i % 5 ? "\"\n" : "\"\r\n";
+    }
+    csv += "200,\"open\n,quote";
+
+    const auto check_parallel = [&](const auto& parser) {
+        auto expected = raw_rows(parser);
+
+        std::sort(expected.begin(), expected.end());
+        for(unsigned threads : { 2, 7, 31, 128 })
+        {
+            // small batches give many more batches than threads to steal
+            for(std::size_t batch_size : { 1 << 20, 16 })
+            {
+                std::mutex mutex;
+                std::vector<std::string> rows;
+                parser.for_each_row_parallel(
+                    [&](auto row) {
+                        std::lock_guard<std::mutex> lock{ mutex };
+                        rows.emplace_back(row.raw());
+                    },
+                    threads,
+                    batch_size);
+                std::sort(rows.begin(), rows.end());
+                REQUIRE_EQ(rows, expected);
+            }
+        }
+    };
+
+    check_parallel(
+        lazycsv::parser<std::string, lazycsv::has_header<false>>{ csv });
+    check_parallel(
+        lazycsv::parser<
+            std::string,
+            lazycsv::has_header<true>,
+            lazycsv::delimiter<','>,
+            lazycsv::quote_char<'"'>,
+            lazycsv::trim_chars<' ', '\t'>,
+            lazycsv::quoted_newlines<true>,
+            lazycsv::structural_index>{ csv });
+}
+
+TEST_CASE("count_rows gives the number of rows")
+{
+    std::string long_rows;
+    for(int i = 0; i < 300; i++)
+        long_rows += "\"a\n\"\"," + std::string(i, 'b') + "\n";
+
+    const std::vector<std::string> inputs{ "",
+                                           "\n",
+                                           "\n\n",
+                                           "A0,B0\nA1\n",
+                                           "A0,B0\nA1",
+                                           "A0,\"B\n0\"\r\n\n",
+                                           "A0\n\"open\n\n",
+                                           "A0\n\"open\n\na",
+                                           long_rows,
+                                           long_rows + "\"" + long_rows };
+
+    for(const auto& csv : inputs)
+    {
+        const lazycsv::parser<std::string> quoted{ csv };
+        const lazycsv::parser<
+            std::string,
+            lazycsv::has_header<false>,
+            lazycsv::delimiter<','>,
+            lazycsv::quote_char<'"'>,
+            lazycsv::trim_chars<' ', '\t'>,
+            lazycsv::quoted_newlines<false>>
+            unquoted{ csv };
+
+        for(unsigned threads : { 1, 3, 16 })
+        {
+            REQUIRE_EQ(
+                quoted.count_rows(threads),
+                std::distance(quoted.begin(), quoted.end()));
+            REQUIRE_EQ(
+                unquoted.count_rows(threads),
+                std::distance(unquoted.begin(), unquoted.end()));
+        }
+    }
+}
+
+TEST_CASE("reduce columns on several threads")
+{
+    std::string csv = "id,name,value\n";
+    for(int i = 1; i <= 1000; i++)
+        csv += std::to_string(i) + ",\"n\n" + std::to_string(i) + "\"," +
+               std::to_string(i % 10) + "\n";
+
+    const lazycsv::parser<std::string> parser{ csv };
+
+    struct stats
+    {
+        long sum{ 0 };
+        int min{ 10 };
+        int max{ -1 };
+    };
+
+    for(unsigned threads : { 1, 4, 32 })
+    {
+        const auto result = parser.reduce(
+            std::array<int, 2>{ 0, 2 },
+            stats{},
+            stats{},
+            [](stats acc, const auto& cells) {
+                const int value = std::stoi(std::string{ cells[1].raw() });
+                acc.sum += std::stol(std::string{ cells[0].raw() });
+                acc.min = std::min(acc.min, value);
+                acc.max = std::max(acc.max, value);
+                return acc;
+            },
+            [](stats lhs, const stats& rhs) {
+                return stats{ lhs.sum + rhs.sum,
+                              std::min(lhs.min, rhs.min),
+                              std::max(lhs.max, rhs.max) };
+            },
+            threads);
+        REQUIRE_EQ(result.sum, 500500);
+        REQUIRE_EQ(result.min, 0);
+        REQUIRE_EQ(result.max, 9);
+    }
+
+    // results are combined in the order of the rows
+    const auto ids = parser.reduce(
+        std::array<int, 1>{ 0 },
+        std::string{},
+        std::string{},
+        [](std::string acc, const auto& cells) {
+            return acc + std::string{ cells[0].raw() } + " ";
+        },
+        [](std::string lhs, const std::string& rhs) { return lhs + rhs; },
+        8);
+    REQUIRE_EQ(ids.substr(0, 10), "1 2 3 4 5 ");
+    REQUIRE_EQ(ids.substr(ids.size() - 9), "999 1000 ");
+
+    // init is folded in once, however many batches there are
+    for(unsigned threads : { 1, 2, 3, 32 })
+    {
+        const auto sum = parser.reduce(
+            std::array<int, 1>{ 0 },
+            1000L,
+            0L,
+            [](long acc, const auto& cells) {
+                return acc + std::stol(std::string{ cells[0].raw() });
+            },
+            [](long lhs, long rhs) { return lhs + rhs; },
+            threads);
+        REQUIRE_EQ(sum, 501500);
+    }
+
+    // batches start from the identity, not from a value-initialized T
+    for(unsigned threads : { 1, 2, 3, 32 })
+    {
+        const auto min = [](int lhs, int rhs) { return (std::min)(lhs, rhs); };
+        const auto lowest = parser.reduce(
+            std::array<int, 1>{ 0 },
+            INT_MAX,
+            INT_MAX,
+            [&](int acc, const auto& cells) {
+                return min(acc, std::stoi(std::string{ cells[0].raw() }));
+            },
+            min,
+            threads);
+        REQUIRE_EQ(lowest, 1);
+    }
+}
+
+TEST_CASE("transform_ordered gives results in the order of the rows")
+{
+    std::string csv = "id,text\n";
+    for(int i = 0; i < 2000; i++)
+        csv += std::to_string(i) + (i % 3 ? ",\"a\nb\"\n" : ",c\n");
+
+    const lazycsv::parser<std::string> parser{ csv };
+    for(unsigned threads : { 1, 3, 16 })
+    {
+        for(std::size_t window : { 1, 2, 0 })
+        {
+            int expected = 0;
+            parser.transform_ordered(
+                [](auto row) {
+                    return std::stoi(std::string{ row.cells(0)[0].raw() });
+                },
+                [&](int id) { REQUIRE_EQ(id, expected++); },
+                threads,
+                window,
+                64);
+            REQUIRE_EQ(expected, 2000);
+        }
+    }
+
+    REQUIRE_THROWS_AS(
+        parser.transform_ordered(
+            [](auto row) { return row.cells(2)[0]; },
+            [](auto) {},
+            4,
+            2,
+            64),
+        lazycsv::error);
+
+    int consumed = 0;
+    REQUIRE_THROWS_AS(
+        parser.transform_ordered(
+            [](auto row) { return row.raw(); },
+            [&](auto) {
+                if(++consumed == 100)
+                    throw std::runtime_error("sink failed");
+            },
+            4,
+            2,
+            64),
+        std::runtime_error);
+    REQUIRE_EQ(consumed, 100);
+}
+
+TEST_CASE("window_mmap_source maps a window of the file at a time")
+{
+    const std::string path = "inputs/window.csv";
+    const std::string csv  = quoted_rows_csv(3000);
+    std::ofstream{ path, std::ios::binary | std::ios::trunc } << csv;
+
+    const auto expected = raw_rows(lazycsv::parser<std::string>{ csv });
+
+    // windows smaller than a page and ones that aren't a multiple of it
+    for(std::size_t window : { 20, 1000, 5000, 1 << 20 })
+    {
+        lazycsv::parser<lazycsv::window_mmap_source> parser{ path, window };
+        REQUIRE_EQ(parser.header().raw(), "id,text");
+        REQUIRE_EQ(raw_rows(parser), expected);
+    }
+
+    lazycsv::parser<lazycsv::window_mmap_source> parser{ path, 10 };
+    REQUIRE_THROWS_AS(
+        for(const auto row : parser) static_cast<void>(row), lazycsv::error);
+
+    std::remove(path.c_str());
+}
+
+#if !defined(_WIN32)
+TEST_CASE("stream_source reads rows from a pipe")
+{
+    const auto cells_of = [](auto&& parser) {
+        std::vector<std::vector<std::string>> rows;
+        for(const auto row : parser)
+        {
+            rows.emplace_back();
+            for(const auto cell : row)
+                rows.back().emplace_back(cell.raw());
+        }
+        return rows;
+    };
+
+    const auto parse_pipe = [&](const std::string& csv, std::size_t window) {
+        int fds[2];
+        REQUIRE_EQ(pipe(fds), 0);
+        // writes in small pieces, so reads return partial windows
+        std::thread writer{ [&]() {
+            for(std::size_t i = 0; i < csv.size(); i += 7)
+            {
+                const auto size = std::min<std::size_t>(7, csv.size() - i);
+                REQUIRE(write(fds[1], csv.data() + i, size) > 0);
+            }
+            close(fds[1]);
+        } };
+
+        std::vector<std::vector<std::string>> rows;
+        try
+        {
+            lazycsv::parser<lazycsv::stream_source> parser{ fds[0], window };
+            REQUIRE_EQ(parser.header().raw(), "id,text");
+            rows = cells_of(parser);
+        }
+        catch(...)
+        {
+            // the writer would get SIGPIPE if the pipe was closed before it
+            // is done
+            char rest[64];
+            while(read(fds[0], rest, sizeof(rest)) > 0)
+                ;
+            close(fds[0]);
+            writer.join();
+            throw;
+        }
+        close(fds[0]);
+        writer.join();
+        return rows;
+    };
+
+    // the end of the pipe is only seen after the newline of the last row, or
+    // after a last row with a quote left open
+    for(const auto& csv :
+        { quoted_rows_csv(300), quoted_rows_csv(300) + "300,\"open\n" })
+    {
+        const auto expected = cells_of(lazycsv::parser<std::string>{ csv });
+        REQUIRE_EQ(parse_pipe(csv, 1 << 20), expected);
+        REQUIRE_EQ(parse_pipe(csv, 20), expected);
+        REQUIRE_THROWS_AS(parse_pipe(csv, 8), lazycsv::error);
+    }
+
+    // rows that fill the window, the last one without a newline, and a row
+    // one byte longer than the window
+    for(const std::string csv : { "id,text\n1,abcde", "id,text\n1,abcde\n" })
+        REQUIRE_EQ(
+            parse_pipe(csv, 7), cells_of(lazycsv::parser<std::string>{ csv }));
+    REQUIRE_THROWS_AS(parse_pipe("id,text\n1,abcdef", 7), lazycsv::error);
+}
+
+TEST_CASE("io_uring_source reads rows ahead of the parser")
+{
+    const std::string path = "inputs/read_ahead.csv";
+    const std::string csv  = quoted_rows_csv(3000);
+    std::ofstream{ path, std::ios::binary | std::ios::trunc } << csv;
+
+    const auto expected = raw_rows(lazycsv::parser<std::string>{ csv });
+
+    // windows and reads much smaller than the file, so rows cross both
+    for(std::size_t read_size : { 1 << 20, 1000, 37 })
+    {
+        lazycsv::parser<lazycsv::io_uring_source> parser{
+            path, 4096, read_size, 3
+        };
+        REQUIRE_EQ(parser.header().raw(), "id,text");
+        REQUIRE_EQ(raw_rows(parser), expected);
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("direct_io_source reads rows without the page cache")
+{
+    const std::string path = "inputs/direct.csv";
+    const std::string csv  = quoted_rows_csv(3000);
+    std::ofstream{ path, std::ios::binary | std::ios::trunc } << csv;
+
+    const auto expected = raw_rows(lazycsv::parser<std::string>{ csv });
+
+    // read sizes are rounded up to whole blocks, and the file doesn't end
+    // on one
+    for(std::size_t read_size : { 1 << 20, 4096, 37 })
+    {
+        lazycsv::parser<lazycsv::direct_io_source> parser{
+            path, 5000, read_size, 2
+        };
+        REQUIRE_EQ(parser.header().raw(), "id,text");
+        REQUIRE_EQ(raw_rows(parser), expected);
+    }
+
+    std::remove(path.c_str());
+}
+#endif // !defined(_WIN32)
+
+#if defined(LAZYCSV_ZLIB)
+TEST_CASE("gzip_source decompresses rows ahead of the parser")
+{
+    const std::string path = "inputs/compressed.csv.gz";
+    const std::string csv  = quoted_rows_csv(3000);
+
+    // two members, like files compressed in parts and concatenated
+    std::remove(path.c_str());
+    const std::string_view halves[] = { std::string_view{ csv }.substr(
+                                            0, csv.size() / 2),
+                                        std::string_view{ csv }.substr(
+                                            csv.size() / 2) };
+    for(const auto half : halves)
+    {
+        const gzFile file = gzopen(path.c_str(), "ab");
+        REQUIRE(file != nullptr);
+        REQUIRE_EQ(
+            gzwrite(file, half.data(), static_cast<unsigned>(half.size())),
+            static_cast<int>(half.size()));
+        REQUIRE_EQ(gzclose(file), Z_OK);
+    }
+
+    const auto expected = raw_rows(lazycsv::parser<std::string>{ csv });
+
+    // chunks much smaller than the window and the other way around
+    for(std::size_t chunk_size : { 1 << 20, 1000, 37 })
+    {
+        lazycsv::parser<lazycsv::gzip_source> parser{
+            path, 4096, chunk_size, 3
+        };
+        REQUIRE_EQ(parser.header().raw(), "id,text");
+        REQUIRE_EQ(raw_rows(parser), expected);
+    }
+
+    // a file cut short isn't taken for the end of the data
+    std::string compressed;
+    {
+        std::ifstream file{ path, std::ios::binary };
+        compressed.assign(std::istreambuf_iterator<char>{ file }, {});
+    }
+    std::ofstream{ path, std::ios::binary | std::ios::trunc }
+        << compressed.substr(0, compressed.size() - 4);
+    const auto parse_truncated = [&]() {
+        for(const auto row : lazycsv::parser<lazycsv::gzip_source>{ path })
+            static_cast<void>(row);
+    };
+    REQUIRE_THROWS_AS(parse_truncated(), lazycsv::error);
+
+    // windows that end on the newline of the last row
+    std::remove(path.c_str());
+    {
+        const gzFile file = gzopen(path.c_str(), "wb");
+        REQUIRE(file != nullptr);
+        REQUIRE_EQ(gzputs(file, "id,text\naaa,48\na,667\na,280\n"), 27);
+        REQUIRE_EQ(gzclose(file), Z_OK);
+    }
+    for(std::size_t window : { 8, 12, 13 })
+        for(std::size_t chunk_size : { 1, 13 })
+            REQUIRE_EQ(
+                raw_rows(lazycsv::parser<lazycsv::gzip_source>{
+                    path, window, chunk_size, 2 }),
+                std::vector<std::string>{ "aaa,48", "a,667", "a,280" });
+
+    std::remove(path.c_str());
+}
+#endif // defined(LAZYCSV_ZLIB)
+
+#if defined(LAZYCSV_ZLIB) || defined(LAZYCSV_ZSTD)
+TEST_CASE("empty compressed files have no rows")
+{
+    const std::string path = "inputs/empty.csv.z";
+    std::ofstream{ path, std::ios::binary | std::ios::trunc };
+
+    const auto check_empty = [](auto&& parser) {
+        REQUIRE_EQ(parser.header().raw(), "");
+        REQUIRE(raw_rows(parser).empty());
+    };
+#if defined(LAZYCSV_ZLIB)
+    check_empty(lazycsv::parser<lazycsv::gzip_source>{ path });
+#endif // defined(LAZYCSV_ZLIB)
+#if defined(LAZYCSV_ZSTD)
+    check_empty(lazycsv::parser<lazycsv::zstd_source>{ path });
+#endif // defined(LAZYCSV_ZSTD)
+
+    std::remove(path.c_str());
+}
+#endif // defined(LAZYCSV_ZLIB) || defined(LAZYCSV_ZSTD)
+
+TEST_CASE("adjacent byte ranges go through each row once")
+{
+    const std::string csv = quoted_rows_csv(300);
+
+    const auto check_ranges = [&](const auto& parser) {
+        const auto expected = raw_rows(parser);
+
+        // ranges that start inside quotes, inside rows and on newlines
+        for(std::uint64_t length : { 1, 7, 100, 5000 })
+        {
+            std::vector<std::string> rows;
+            for(std::uint64_t offset = 0; offset < csv.size(); offset += length)
+                for(const auto row : parser.rows_in_range(offset, length))
+                    rows.emplace_back(row.raw());
+            REQUIRE_EQ(rows, expected);
+        }
+        REQUIRE_EQ(parser.header().raw(), "id,text");
+    };
+
+    check_ranges(lazycsv::parser<std::string>{ csv });
+
+    lazycsv::parser<
+        std::string,
+        lazycsv::has_header<true>,
+        lazycsv::delimiter<','>,
+        lazycsv::quote_char<'"'>,
+        lazycsv::trim_chars<' ', '\t'>,
+        lazycsv::quoted_newlines<true>,
+        lazycsv::row_index>
+        indexed{ csv };
+    check_ranges(indexed);
+
+    lazycsv::parser<
+        std::string,
+        lazycsv::has_header<true>,
+        lazycsv::delimiter<','>,
+        lazycsv::quote_char<'"'>,
+        lazycsv::trim_chars<' ', '\t'>,
+        lazycsv::quoted_newlines<true>,
+        lazycsv::checkpoint_index>
+        checkpointed{ csv };
+    checkpointed.build_index(lazycsv::checkpoint_index{ 16 });
+    check_ranges(checkpointed);
+}
+
+TEST_CASE("planned ranges go through each row once")
+{
+    std::string csv = "id,text\n";
+    for(int i = 0; i < 3000; i++)
+        csv += std::to_string(i) + (i < 1500 ? ",\"a\nb\"\n" : ",c\n");
+    lazycsv::parser<std::string> parser{ csv };
+
+    const auto expected = raw_rows(parser);
+
+    for(const auto by : { lazycsv::balance::bytes, lazycsv::balance::rows })
+    {
+        const auto plan = parser.plan_ranges(4, by, 2);
+        REQUIRE_EQ(plan.size(), 4);
+
+        std::vector<std::string> rows;
+        std::vector<std::size_t> counts;
+        for(const auto& range : plan)
+        {
+            counts.push_back(rows.size());
+            for(const auto row : parser.rows_of(range))
+                rows.emplace_back(row.raw());
+            counts.back() = rows.size() - counts.back();
+        }
+        REQUIRE_EQ(rows, expected);
+        if(by == lazycsv::balance::rows)
+            REQUIRE_EQ(counts, std::vector<std::size_t>(4, 750));
+    }
+
+    const std::string path = "inputs/plan.txt";
+    const auto plan        = parser.plan_ranges(3);
+    parser.save_plan(path, plan);
+    const auto loaded = parser.load_plan(path);
+    REQUIRE_EQ(loaded.size(), plan.size());
+    for(std::size_t i = 0; i < plan.size(); i++)
+    {
+        REQUIRE_EQ(loaded[i].offset, plan[i].offset);
+        REQUIRE_EQ(loaded[i].length, plan[i].length);
+    }
+
+    // a plan is only good for the data it was made for
+    lazycsv::parser<std::string> changed{ csv + "3000,d\n" };
+    REQUIRE_THROWS_AS(changed.load_plan(path), lazycsv::error);
+    // and the header it was made with
+    const lazycsv::parser<std::string, lazycsv::has_header<false>> headless{
+        csv
+    };
+    REQUIRE_THROWS_AS(headless.load_plan(path), lazycsv::error);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("multi_parser goes through the rows of all shards")
+{
+    const std::vector<std::string> paths{ "inputs/part-0.csv",
+                                          "inputs/part-1.csv",
+                                          "inputs/part-2.csv",
+                                          "inputs/part-3.csv" };
+    std::ofstream{ paths[0], std::ios::binary } << "id,text\n0,a\n1,\"b\nc\"\n";
+    std::ofstream{ paths[1], std::ios::binary } << "";
+    std::ofstream{ paths[2], std::ios::binary } << "id,text\r\n";
+    std::ofstream{ paths[3], std::ios::binary } << "id,text\n2,d\n3,e";
+
+    lazycsv::multi_parser<> parser{ paths };
+    REQUIRE_EQ(parser.shards(), 4);
+    const auto [id, text] = parser.header().cells(0, 1);
+    REQUIRE_EQ(id.raw(), "id");
+    REQUIRE_EQ(text.raw(), "text");
+
+    std::vector<std::string> rows;
+    for(const auto row : parser)
+        rows.emplace_back(row.raw());
+    REQUIRE_EQ(
+        rows,
+        std::vector<std::string>{ "0,a", "1,\"b\nc\"", "2,d", "3,e" });
+
+    // default iterators compare without a parser
+    using iterator = lazycsv::multi_parser<>::iterator;
+    REQUIRE(iterator{} == iterator{});
+    REQUIRE(parser.end() != iterator{});
+
+    std::atomic<int> sum{ 0 };
+    parser.for_each_row_parallel(
+        [&](const auto row) {
+            sum += std::stoi(std::string{ row.cells(0)[0].raw() });
+        },
+        2);
+    REQUIRE_EQ(sum, 6);
+
+    // without a shard that isn't empty the header is empty, as for an empty
+    // file
+    for(const auto& shards :
+        { std::vector<std::string>{}, std::vector<std::string>{ paths[1] } })
+    {
+        lazycsv::multi_parser<> empty{ shards };
+        REQUIRE_EQ(empty.header().raw(), "");
+        REQUIRE(empty.begin() == empty.end());
+    }
+
+    std::ofstream{ paths[3], std::ios::binary } << "id,name\n2,d\n";
+    lazycsv::multi_parser<> mismatched{ paths };
+    const auto count_rows = [&]() {
+        return std::distance(mismatched.begin(), mismatched.end());
+    };
+    REQUIRE_THROWS_AS(count_rows(), lazycsv::error);
+    REQUIRE_THROWS_AS(
+        mismatched.for_each_shard_parallel(
+            [](const auto&, std::size_t) {}, 2),
+        lazycsv::error);
+
+    for(const auto& path : paths)
+        std::remove(path.c_str());
+}
+
+TEST_CASE("all kernels give the same rows and cells")
+{
+    std::string csv;
+    for(int i = 0; i < 300; i++)
+    {
+        csv += std::string(i % 7, 'x') + ",";
+        if(i % 5 == 0)
+            csv += "\"q,\"\"\n" + std::string(i % 90, 'y') + "\"";
+        csv += i % 11 == 0 ? "\r\n" : (i % 13 == 0 ? "\n" : ",");
+    }
+
+    using scanning = lazycsv::parser<std::string, lazycsv::has_header<false>>;
+    using indexed  = lazycsv::parser<
+        std::string,
+        lazycsv::has_header<false>,
+        lazycsv::delimiter<','>,
+        lazycsv::quote_char<'"'>,
+        lazycsv::trim_chars<' ', '\t'>,
+        lazycsv::quoted_newlines<true>,
+        lazycsv::structural_index>;
+
+    const auto cells_of = [](const auto& parser) {
+        std::vector<std::vector<std::string_view>> rows;
+        for(const auto row : parser)
+        {
+            rows.emplace_back();
+            for(const auto cell : row)
+                rows.back().push_back(cell.raw());
+        }
+        return rows;
+    };
+
+    const auto active = lazycsv::active_kernel();
+    REQUIRE(lazycsv::kernel_supported(active));
+    REQUIRE(lazycsv::kernel_supported(lazycsv::kernel::scalar));
+
+    lazycsv::set_kernel(lazycsv::kernel::scalar);
+    const scanning reference_parser{ csv };
+    const auto reference = cells_of(reference_parser);
+    REQUIRE_EQ(reference.size(), 49);
+
+    for(const auto k : { lazycsv::kernel::scalar,
+                         lazycsv::kernel::swar,
+                         lazycsv::kernel::sse2,
+                         lazycsv::kernel::avx2,
+                         lazycsv::kernel::avx512 })
+    {
+        if(!lazycsv::kernel_supported(k))
+        {
+            REQUIRE_THROWS_AS(lazycsv::set_kernel(k), lazycsv::error);
+            continue;
+        }
+        lazycsv::set_kernel(k);
+        REQUIRE(reference == cells_of(scanning{ csv }));
+        REQUIRE(reference == cells_of(indexed{ csv }));
+    }
+    lazycsv::set_kernel(active);
+}